@@ -0,0 +1,103 @@
+; File: smp_low.asm
+;
+; Low level code for the application processors.
+;
+; April 28, 2024
+
+; ----------------------------------------------------------------------
+; smp_trampoline
+;
+; An application processor starts in real mode, at the page that the
+; start-up IPI names. SMP::start_ap copies the code between
+; _smp_trampoline and _smp_trampoline_end to TRAMPOLINE, below 1MB, so
+; everything in here is addressed relative to where it runs, not where it
+; was linked. It switches to protected mode with a GDT of its own, loads
+; the stack that SMP::start_ap left in _smp_ap_stack, and calls
+; smp_ap_entry (which calls SMP::ap_main) at its linked address.
+;
+; ----------------------------------------------------------------------
+
+TRAMPOLINE equ 0x7000	; keep in sync with SMP::TRAMPOLINE
+
+KERNEL_CS equ 1<<3	; same as in the kernel GDT
+KERNEL_DS equ 2<<3
+
+%define TRAMP(label) (TRAMPOLINE + (label - _smp_trampoline))
+
+extern _smp_ap_stack	; defined in smp.C
+extern _smp_ap_entry
+extern _smp_lapic_eoi
+
+global _smp_trampoline
+global _smp_trampoline_end
+
+align 16
+[BITS 16]
+_smp_trampoline:
+	cli
+	cld
+	xor	ax, ax
+	mov	ds, ax
+	o32 lgdt [TRAMP(trampoline_gdt_ptr)]
+	mov	eax, cr0
+	or	eax, 1		; PE
+	mov	cr0, eax
+	jmp	dword KERNEL_CS:TRAMP(trampoline_32)
+
+[BITS 32]
+trampoline_32:
+	mov	ax, KERNEL_DS
+	mov	ds, ax
+	mov	es, ax
+	mov	fs, ax
+	mov	gs, ax
+	mov	ss, ax
+	mov	esp, [_smp_ap_stack]
+	; an absolute call: a relative one would be off by the copy
+	mov	eax, _smp_ap_entry
+	call	eax
+.hang:
+	hlt
+	jmp	.hang
+
+align 8
+trampoline_gdt:
+	dq	0			; null
+	dq	0x00CF9A000000FFFF	; code: base 0, limit 4GB, 32-bit
+	dq	0x00CF92000000FFFF	; data: base 0, limit 4GB
+trampoline_gdt_ptr:
+	dw	3*8 - 1
+	dd	TRAMP(trampoline_gdt)
+
+_smp_trampoline_end:
+
+
+; ----------------------------------------------------------------------
+; smp_wakeup_stub
+;
+; The wake-up IPI (SMP::WAKEUP_VECTOR). Getting here is all it is for:
+; it acknowledges the interrupt at the local APIC and returns.
+;
+; ----------------------------------------------------------------------
+
+global _smp_wakeup_stub
+align 16
+_smp_wakeup_stub:
+	push	eax
+	mov	eax, [_smp_lapic_eoi]
+	mov	dword [eax], 0
+	pop	eax
+	iret
+
+
+; ----------------------------------------------------------------------
+; smp_spurious_stub
+;
+; Spurious interrupts of the local APIC. They need no acknowledgement.
+;
+; ----------------------------------------------------------------------
+
+global _smp_spurious_stub
+align 16
+_smp_spurious_stub:
+	iret
@@ -24,6 +24,8 @@ KERNEL_DS equ 2<<3	; kernel data segment is GDT entry 2
 
 INTERRUPT_STATE_SIZE equ 68 ; size of exception frame on stack
 
+FAST_FRAME equ 4	; offset of 'fast_frame' in class Thread
+
 ; Save registers prior to calling a handler function.
 ; This must be kept up to date with:
 ;   - REGS (register context) struct in machine.h
@@ -47,7 +49,8 @@ INTERRUPT_STATE_SIZE equ 68 ; size of exception frame on stack
 	add	esp, 8	; skip int num and error code
 %endmacro
 
-extern _current_thread  ; defined and initialized in threads.c
+CURRENT_THREAD equ 4	; offset of 'current_thread' in class CPU; GS
+			; points at the CPU we run on (see smp.H)
 
 
 global _threads_low_switch_to
@@ -61,7 +64,7 @@ _threads_low_switch_to:
 	; don't need to do anything with setting up and saving the current
         ; context. We simply proceed to loading the new context. 
 
-	cmp	[_current_thread], dword 0
+	cmp	[gs:CURRENT_THREAD], dword 0
 	je	.context_load_only
 
 	; Modify the stack to allow a later return via an iret instruction.
@@ -94,37 +97,99 @@ _threads_low_switch_to:
 	; Save general purpose registers.
 	save_registers
 
-	; Save stack pointer in the thread context struct (at offset 0).
-	mov	eax, [_current_thread]
+	; Save stack pointer in the thread context struct (at offset 0),
+	; and note that it points at a full frame.
+	mov	eax, [gs:CURRENT_THREAD]
 	mov	[eax+0], esp
+	mov	[eax+FAST_FRAME], dword 0
 
 	; Load the pointer to the new thread context into eax.
 	; We skip over the Interrupt_State struct on the stack to
 	; get the parameter.
 	mov	eax, dword [esp+INTERRUPT_STATE_SIZE]
-
-	; Make the new thread current, and switch to its stack.
-	mov	[_current_thread], eax
-	mov	esp, [eax+0]
-
-	; Restore general purpose and segment registers, and clear interrupt
-	; number and error code.
-	restore_registers
-
-	; We'll return to the place where the thread was
-	; executing last.
-	iret
+	jmp	threads_low_load_context
 
 .context_load_only:
 
 	; We skipped the whole exception frame setup, and just need to 
         ; store the thread pointer into eax.
         mov	eax, [esp+4]
+	jmp	threads_low_load_context
+
+
+; ----------------------------------------------------------------------
+; threads_low_yield_to(Thread * _thread)
+;
+; Same as threads_low_switch_to, for threads that give up the CPU by
+; calling into the scheduler. The C calling convention lets the caller
+; assume that eax, ecx and edx are lost across the call, and the segment
+; registers never change in the kernel. So we only save ebx, esi, edi and
+; ebp, and the flags (for the interrupt state), on the stack:
+;
+;            thread_ptr
+;            return addr
+;            eflags
+;            ebp
+;            ebx
+;            esi
+;    esp --> edi
+;
+; ----------------------------------------------------------------------
+
+global _threads_low_yield_to
+align 16
+_threads_low_yield_to:
+
+	cmp	[gs:CURRENT_THREAD], dword 0
+	je	.context_load_only
+
+	pushfd
+	push	ebp
+	push	ebx
+	push	esi
+	push	edi
+
+	; Save stack pointer, and note that it points at a short frame.
+	mov	eax, [gs:CURRENT_THREAD]
+	mov	[eax+0], esp
+	mov	[eax+FAST_FRAME], dword 1
+
+	; The parameter is above the five registers and the return address.
+	mov	eax, [esp+24]
+	jmp	threads_low_load_context
+
+.context_load_only:
+	mov	eax, [esp+4]
+	jmp	threads_low_load_context
+
+
+; ----------------------------------------------------------------------
+; threads_low_load_context
+;
+; Makes the thread in eax current, switches to its stack and returns to
+; where it stopped, through the kind of frame it left there.
+; ----------------------------------------------------------------------
+
+align 16
+threads_low_load_context:
 
 	; Make the new thread current, and switch to its stack.
-	mov	[_current_thread], eax
+	mov	[gs:CURRENT_THREAD], eax
 	mov	esp, [eax+0]
 
+	cmp	[eax+FAST_FRAME], dword 0
+	je	.full_frame
+
+	; Short frame: back into the thread's call to threads_low_yield_to.
+	pop	edi
+	pop	esi
+	pop	ebx
+	pop	ebp
+	popfd
+	ret
+
+.full_frame:
+
 	; Restore general purpose and segment registers, and clear interrupt
 	; number and error code.
 	restore_registers